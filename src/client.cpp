@@ -0,0 +1,123 @@
+#include "daemon_protocol.h"
+#include "options.h"
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+// Thin client for compute_daemon. Does not depend on Vulkan.
+namespace
+{
+    std::vector<float> loadArray(const std::string &path)
+    {
+        std::ifstream in(path);
+
+        if (!in)
+            throw std::runtime_error("Failed to open " + path);
+
+        return std::vector<float>(std::istream_iterator<float>(in), std::istream_iterator<float>());
+    }
+
+    void saveArray(const std::string &path, const float *array, size_t size)
+    {
+        std::ofstream out(path);
+        for (size_t i = 0; i < size; ++i)
+            out << array[i] << ' ';
+    }
+}
+
+int main(const int argc, const char* const argv[]) try
+{
+    using namespace noxitu::daemon;
+
+    const std::vector<std::string> args(argv+1, argv+argc);
+
+    const std::string socketPath = noxitu::getOption(args, "--socket", DEFAULT_SOCKET_PATH);
+    const std::string inputPath = noxitu::getOption(args, "--input", "");
+    const std::string outputPath = noxitu::getOption(args, "--output", "/tmp/array.txt");
+
+    RequestHeader request{};
+    request.width = std::stoul(noxitu::getOption(args, "--width", "128"));
+    request.height = std::stoul(noxitu::getOption(args, "--height", "128"));
+    request.flags = 0;
+
+    std::vector<float> input;
+
+    if (!inputPath.empty())
+    {
+        input = loadArray(inputPath);
+
+        if (input.size() != 4ull*request.width*request.height)
+            throw std::runtime_error("Input must contain 4*width*height values");
+
+        request.flags |= REQUEST_HAS_INPUT;
+    }
+
+    const auto startTime = std::chrono::steady_clock::now();
+
+    FileDescriptor socket(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+
+    if (!socket)
+        throw std::system_error(errno, std::generic_category(), "socket failed");
+
+    const sockaddr_un address = socketAddress(socketPath);
+
+    if (::connect(socket.get(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+        throw std::system_error(errno, std::generic_category(), "connect to " + socketPath + " failed");
+
+    sendAll(socket.get(), &request, sizeof(request));
+
+    if (!input.empty())
+        sendAll(socket.get(), input.data(), input.size()*sizeof(float));
+
+    ResponseHeader response{};
+    FileDescriptor memfd(recvWithFd(socket.get(), &response, sizeof(response)));
+
+    if (response.magic != PROTOCOL_MAGIC)
+        throw std::runtime_error("Invalid response");
+
+    if (response.status != Status::Ok)
+    {
+        std::string message(response.messageLength, '\0');
+        recvAll(socket.get(), message.data(), message.size());
+        throw std::runtime_error("Daemon failed: " + message);
+    }
+
+    if (!memfd)
+        throw std::runtime_error("Daemon did not send result memory");
+
+    void *memory = ::mmap(nullptr, response.byteSize, PROT_READ, MAP_SHARED, memfd.get(), 0);
+
+    if (memory == MAP_FAILED)
+        throw std::system_error(errno, std::generic_category(), "mmap failed");
+
+    std::shared_ptr<void> unmap(memory, [&](void *memory) { ::munmap(memory, response.byteSize); });
+
+    const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime);
+    std::cerr << "Job done in " << elapsed.count() << "us (" << response.width << "x" << response.height << ")" << std::endl;
+
+    saveArray(outputPath, reinterpret_cast<const float*>(memory), response.byteSize/sizeof(float));
+
+    return EXIT_SUCCESS;
+}
+catch(const std::exception &ex)
+{
+    std::cerr << "main() failed with exception " << typeid(ex).name() << ": " << ex.what() << std::endl;
+    return EXIT_FAILURE;
+}
+catch(...)
+{
+    std::cerr << "main() failed" << std::endl;
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,697 @@
+#include "compute_context.h"
+
+#include "metrics.h"
+#include "shaders/comp.spv.h"
+#include "utils.h"
+#include "validation_layer.h"
+#include "vulkan_helpers.h"
+
+#include <vulkan/vulkan.hpp>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+
+namespace noxitu::compute
+{
+    namespace
+    {
+        void printPhysicalDevices(const std::vector<vk::PhysicalDevice> &physicalDevices)
+        {
+            std::cerr << noxitu::log(__FILE__, __LINE__) << "Found Physical Devices:\n";
+
+            for (const vk::PhysicalDevice &device : physicalDevices)
+            {
+                const vk::PhysicalDeviceProperties properties = device.getProperties();
+
+                std::cerr << noxitu::log(__FILE__, __LINE__) << " * " << properties.deviceName << '\n';
+            }
+
+            std::cerr << noxitu::log(__FILE__, __LINE__) << std::endl;
+        }
+    }
+
+    struct JobSlot
+    {
+        vk::Buffer buffer;
+        vk::DeviceMemory memory;
+        std::shared_ptr<noxitu::span<float>> memoryView;
+
+        // Dispatch arguments followed by tile offsets, layout matches `Tiles` in shader.comp.glsl.
+        vk::Buffer tileBuffer;
+        vk::DeviceMemory tileMemory;
+        std::shared_ptr<noxitu::span<uint32_t>> tileView;
+
+        vk::DescriptorPool descriptorPool;
+        std::vector<vk::DescriptorSet> descriptorSets;
+        vk::CommandPool commandPool;
+        vk::CommandBuffer commandBuffer;
+
+        // Set when waiting for slot's fence failed (e.g. device lost). Its work may still be in flight,
+        // so the slot is never reused - releaseSlot() retires it instead.
+        bool failed = false;
+    };
+
+    namespace
+    {
+        struct PendingJob
+        {
+            JobSlot *slot = nullptr;
+            bool releaseAfterCompletion = true;
+            std::function<void()> wait;
+            std::function<void(const noxitu::span<const float>&)> complete;
+            std::function<void(std::exception_ptr)> fail;
+        };
+
+        const std::vector<int>& allTiles()
+        {
+            static const std::vector<int> tiles = []()
+            {
+                std::vector<int> tiles(GRID_TILES);
+                for (int i = 0; i < GRID_TILES; ++i)
+                    tiles[i] = i;
+                return tiles;
+            }();
+
+            return tiles;
+        }
+
+        void writeTileTable(JobSlot &slot, const std::vector<int> &tiles)
+        {
+            noxitu::span<uint32_t> &tileView = *slot.tileView;
+
+            tileView[0] = tiles.size();
+            tileView[1] = 1;
+            tileView[2] = 1;
+            tileView[3] = tiles.size();
+
+            for (size_t i = 0; i < tiles.size(); ++i)
+            {
+                tileView[4 + 2*i] = (tiles[i] % GRID_TILES_X) * TILE_SIZE;
+                tileView[4 + 2*i + 1] = (tiles[i] / GRID_TILES_X) * TILE_SIZE;
+            }
+        }
+
+        // Calls `callback(offset, count)` for every row of the tile, in floats from the start of the grid.
+        template<typename Callback>
+        void forEachTileRow(int tile, Callback callback)
+        {
+            const int tileX = (tile % GRID_TILES_X) * TILE_SIZE;
+            const int tileY = (tile / GRID_TILES_X) * TILE_SIZE;
+
+            for (int row = 0; row < TILE_SIZE; ++row)
+                callback(4 * ((tileY + row) * GRID_WIDTH + tileX), 4 * TILE_SIZE);
+        }
+    }
+
+    class ComputeContext::Impl
+    {
+    public:
+        // Declared first, so that final dump happens after everything else is destroyed.
+        std::unique_ptr<noxitu::metrics::Exporter> metricsExporter;
+
+        noxitu::vulkan::validation_layer::ValidationLayer validationLayer;
+        vk::Instance instance;
+        vk::PhysicalDevice physicalDevice;
+        vk::Device device;
+        vk::Queue queue;
+        int queueFamilyIndex;
+        std::unique_ptr<noxitu::vulkan::MyComputePipeline> pipeline;
+
+        const int bufferSize = GRID_FLOATS*sizeof(float);
+        const int tileBufferSize = (4 + 2*GRID_TILES)*sizeof(uint32_t);
+
+        const int maxJobSlots;
+
+        // Guards slot pool and pending jobs. Never held while slot is created or filled.
+        std::mutex mutex;
+        std::condition_variable pendingChanged;
+        std::condition_variable slotReleased;
+        std::vector<std::unique_ptr<JobSlot>> slots;
+        std::vector<JobSlot*> freeSlots;
+        // Failed slots, destroyed only after device.waitIdle(). They do not count towards maxJobSlots.
+        std::vector<std::unique_ptr<JobSlot>> retiredSlots;
+        int slotsBeingCreated = 0;
+        std::deque<PendingJob> pendingJobs;
+        bool stopping = false;
+
+        std::thread completionThread;
+
+        Impl(const ComputeContextOptions &options) :
+            maxJobSlots(options.maxJobSlots)
+        {
+            if (maxJobSlots < 1)
+                throw std::invalid_argument("maxJobSlots must be positive");
+
+            if (!options.metricsPath.empty())
+                metricsExporter = std::make_unique<noxitu::metrics::Exporter>(options.metricsPath, options.metricsFormat, options.metricsInterval);
+
+            std::vector<const char*> enabledLayers;
+            std::vector<const char*> enabledExtensions;
+
+            if (options.enableValidationLayer)
+            {
+                const bool enabled = validationLayer.enable(enabledLayers, enabledExtensions);
+
+                if (!enabled)
+                {
+                    std::cerr << noxitu::log(__FILE__, __LINE__) << "Validation layer is not available!" << std::endl;
+                }
+            }
+
+            vk::ApplicationInfo applicationInfo(
+                "Noxitu Application Name",
+                0, // App Version
+                "Noxitu Engine Name",
+                0, // Engine Version
+                VK_API_VERSION_1_0
+            );
+
+            instance = noxitu::vulkan::createInstance(applicationInfo, enabledLayers, enabledExtensions);
+
+            validationLayer.addCallback(instance, std::cerr);
+
+#ifdef __linux__
+            validationLayer.addCallback(instance, std::ofstream("/tmp/vulkan_log.txt"), true);
+#endif
+
+            physicalDevice = [&]()
+            {
+                const auto physicalDevices = instance.enumeratePhysicalDevices();
+                printPhysicalDevices(physicalDevices);
+                return noxitu::vulkan::findPhysicalDevice(physicalDevices, [](auto&) {return true;});
+            }();
+
+            std::cerr << noxitu::log(__FILE__, __LINE__) << "Using device: " << physicalDevice.getProperties().deviceName << std::endl;
+
+            std::tie(device, queue, queueFamilyIndex) = noxitu::vulkan::createDevice(physicalDevice, enabledLayers);
+
+            pipeline = std::make_unique<noxitu::vulkan::MyComputePipeline>(device, src_shaders_comp_spv, src_shaders_comp_spv_len);
+
+            completionThread = std::thread([this]() { completionLoop(); });
+        }
+
+        ~Impl()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            pendingChanged.notify_all();
+            slotReleased.notify_all();
+            completionThread.join();
+
+            std::cerr << noxitu::log(__FILE__, __LINE__) << "Destroying..." << std::endl;
+
+            device.waitIdle();
+
+            for (auto &slot : slots)
+                destroySlot(*slot);
+
+            for (auto &slot : retiredSlots)
+                destroySlot(*slot);
+
+            pipeline->destroy(device);
+            device.destroy();
+
+            validationLayer.destroy();
+            instance.destroy();
+        }
+
+        std::unique_ptr<JobSlot> createSlot()
+        {
+            auto slot = std::make_unique<JobSlot>();
+
+            slot->buffer = noxitu::vulkan::createBuffer(device, bufferSize);
+            slot->memory = noxitu::vulkan::allocateBuffer(slot->buffer, physicalDevice, device);
+            slot->memoryView = noxitu::vulkan::mapMemory<float>(device, slot->memory, bufferSize);
+
+            slot->tileBuffer = noxitu::vulkan::createBuffer(device, tileBufferSize, vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer);
+            slot->tileMemory = noxitu::vulkan::allocateBuffer(slot->tileBuffer, physicalDevice, device);
+            slot->tileView = noxitu::vulkan::mapMemory<uint32_t>(device, slot->tileMemory, tileBufferSize);
+
+            const std::vector<vk::DescriptorBufferInfo> bufferInfos = {
+                vk::DescriptorBufferInfo(slot->buffer, 0, bufferSize),
+                vk::DescriptorBufferInfo(slot->tileBuffer, 0, tileBufferSize)
+            };
+
+            std::tie(slot->descriptorPool, slot->descriptorSets) = noxitu::vulkan::createDescriptors(device, bufferInfos, pipeline->descriptorSetLayouts);
+            std::tie(slot->commandPool, slot->commandBuffer) = noxitu::vulkan::createCommandBuffer(device, pipeline->pipeline, pipeline->pipelineLayout, slot->descriptorSets, slot->tileBuffer, queueFamilyIndex);
+
+            return slot;
+        }
+
+        void destroySlot(JobSlot &slot)
+        {
+            device.freeCommandBuffers(slot.commandPool, {slot.commandBuffer});
+            device.destroyCommandPool(slot.commandPool);
+
+            device.destroyDescriptorPool(slot.descriptorPool);
+
+            slot.tileView.reset();
+            device.destroyBuffer(slot.tileBuffer);
+            device.freeMemory(slot.tileMemory);
+
+            slot.memoryView.reset();
+            device.destroyBuffer(slot.buffer);
+            device.freeMemory(slot.memory);
+        }
+
+        // Returns free slot, creates a new one (without holding the mutex) if pool is not full yet,
+        // or waits until some slot is released.
+        JobSlot* acquireSlot()
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+
+                slotReleased.wait(lock, [&]()
+                {
+                    return stopping || !freeSlots.empty() || static_cast<int>(slots.size()) + slotsBeingCreated < maxJobSlots;
+                });
+
+                if (stopping)
+                    throw std::runtime_error("ComputeContext is being destroyed");
+
+                if (!freeSlots.empty())
+                {
+                    JobSlot *slot = freeSlots.back();
+                    freeSlots.pop_back();
+                    return slot;
+                }
+
+                ++slotsBeingCreated;
+            }
+
+            std::unique_ptr<JobSlot> slot;
+
+            try
+            {
+                slot = createSlot();
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                --slotsBeingCreated;
+                slotReleased.notify_one();
+                throw;
+            }
+
+            std::lock_guard<std::mutex> lock(mutex);
+            --slotsBeingCreated;
+            slots.push_back(std::move(slot));
+            return slots.back().get();
+        }
+
+        void releaseSlot(JobSlot *slot)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                if (slot->failed)
+                {
+                    auto it = std::find_if(slots.begin(), slots.end(), [&](const auto &owned) { return owned.get() == slot; });
+                    retiredSlots.push_back(std::move(*it));
+                    slots.erase(it);
+                }
+                else
+                {
+                    freeSlots.push_back(slot);
+                }
+            }
+            slotReleased.notify_one();
+        }
+
+        // Slot memory and tile table must be already filled. Mutex is held only for the submit itself,
+        // as it also keeps pending jobs in queue order.
+        void submitSlot(JobSlot *slot,
+                        bool releaseAfterCompletion,
+                        std::function<void(const noxitu::span<const float>&)> complete,
+                        std::function<void(std::exception_ptr)> fail)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                if (stopping)
+                    throw std::runtime_error("ComputeContext is being destroyed");
+
+                PendingJob pending{slot, releaseAfterCompletion, {}, std::move(complete), std::move(fail)};
+                pending.wait = noxitu::vulkan::submitCommandBuffer(device, {slot->commandBuffer}, queue);
+
+                pendingJobs.push_back(std::move(pending));
+            }
+            pendingChanged.notify_one();
+        }
+
+        void enqueue(ComputeJob job,
+                     std::function<void(const noxitu::span<const float>&)> complete,
+                     std::function<void(std::exception_ptr)> fail)
+        {
+            if (!job.pixels.empty() && job.pixels.size() != static_cast<size_t>(GRID_FLOATS))
+                throw std::invalid_argument("Invalid job size");
+
+            JobSlot *slot = acquireSlot();
+
+            // Slot is exclusively ours until submitted, so it is filled without locking.
+            noxitu::span<float> &memoryView = *slot->memoryView;
+
+            writeTileTable(*slot, allTiles());
+
+            if (job.pixels.empty())
+            {
+                std::fill(memoryView.begin(), memoryView.end(), 0.0f);
+            }
+            else
+            {
+                std::copy(job.pixels.begin(), job.pixels.end(), memoryView.begin());
+                noxitu::metrics::metrics().uploadedBytes.add(job.pixels.size()*sizeof(float));
+            }
+
+            try
+            {
+                submitSlot(slot, true, std::move(complete), std::move(fail));
+            }
+            catch (...)
+            {
+                releaseSlot(slot);
+                throw;
+            }
+        }
+
+        // Queue executes submissions in order, so pending jobs are awaited in FIFO order.
+        void completionLoop()
+        {
+            while (true)
+            {
+                PendingJob job;
+
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    pendingChanged.wait(lock, [&]() { return stopping || !pendingJobs.empty(); });
+
+                    if (pendingJobs.empty())
+                        return;
+
+                    job = std::move(pendingJobs.front());
+                    pendingJobs.pop_front();
+                }
+
+                bool waited = false;
+
+                try
+                {
+                    job.wait();
+                    waited = true;
+
+                    job.complete(*job.slot->memoryView);
+
+                    noxitu::metrics::metrics().jobsCompleted.add();
+                }
+                catch (...)
+                {
+                    // Set before failing the job, so that its owner sees it once the future is ready.
+                    if (!waited)
+                        job.slot->failed = true;
+
+                    noxitu::metrics::metrics().jobsFailed.add();
+                    job.fail(std::current_exception());
+                }
+
+                if (job.releaseAfterCompletion)
+                    releaseSlot(job.slot);
+            }
+        }
+    };
+
+    ComputeContext::ComputeContext(const ComputeContextOptions &options) :
+        m_impl(std::make_unique<Impl>(options))
+    {
+    }
+
+    ComputeContext::~ComputeContext() = default;
+
+    std::future<std::vector<float>> ComputeContext::submit(ComputeJob job)
+    {
+        auto promise = std::make_shared<std::promise<std::vector<float>>>();
+        auto future = promise->get_future();
+
+        m_impl->enqueue(
+            std::move(job),
+            [promise](const noxitu::span<const float> &result)
+            {
+                noxitu::metrics::metrics().readBackBytes.add(result.size()*sizeof(float));
+                promise->set_value(std::vector<float>(result.begin(), result.end()));
+            },
+            [promise](std::exception_ptr ex)
+            {
+                promise->set_exception(ex);
+            }
+        );
+
+        return future;
+    }
+
+    std::future<void> ComputeContext::submit(ComputeJob job, noxitu::span<float> output)
+    {
+        if (output.size() != static_cast<size_t>(GRID_FLOATS))
+            throw std::invalid_argument("Invalid output size");
+
+        auto promise = std::make_shared<std::promise<void>>();
+        auto future = promise->get_future();
+
+        m_impl->enqueue(
+            std::move(job),
+            [promise, output](const noxitu::span<const float> &result) mutable
+            {
+                noxitu::metrics::metrics().readBackBytes.add(result.size()*sizeof(float));
+                std::copy(result.begin(), result.end(), output.begin());
+                promise->set_value();
+            },
+            [promise](std::exception_ptr ex)
+            {
+                promise->set_exception(ex);
+            }
+        );
+
+        return future;
+    }
+
+    class IncrementalSession::Impl
+    {
+    public:
+        ComputeContext::Impl &context;
+        // Null only if replacing a failed slot did not succeed - next run() tries again.
+        JobSlot *slot;
+
+        // Values written by write(), dirty tiles are uploaded from here. Kept apart from `output`, because
+        // the shader overwrites pixels in place.
+        std::vector<float> input;
+        // Only modified by collect() on caller's thread - never by the completion thread.
+        std::vector<float> output;
+        std::vector<bool> dirtyTiles;
+        std::shared_future<void> pending;
+        // Tiles of the pending run, whose results were not yet copied from the slot into `output`.
+        std::vector<int> pendingTiles;
+
+        Impl(ComputeContext::Impl &context, JobSlot *slot) :
+            context(context),
+            slot(slot),
+            input(GRID_FLOATS, 0.0f),
+            output(GRID_FLOATS, 0.0f),
+            dirtyTiles(GRID_TILES, true)
+        {
+        }
+
+        ~Impl()
+        {
+            if (pending.valid())
+                pending.wait();
+
+            if (slot)
+                context.releaseSlot(slot);
+        }
+
+        // Waits for pending run and, if it succeeded, copies its tiles from the slot into `output`.
+        // Tiles stay dirty until then, so that tiles of a failed run are retried by the next one.
+        void collect()
+        {
+            if (!pending.valid())
+                return;
+
+            pending.wait();
+
+            if (pendingTiles.empty())
+                return;
+
+            const std::vector<int> tiles = std::move(pendingTiles);
+            pendingTiles.clear();
+
+            try
+            {
+                pending.get();
+            }
+            catch (...)
+            {
+                return;
+            }
+
+            const noxitu::span<float> &memoryView = *slot->memoryView;
+
+            for (int tile : tiles)
+            {
+                dirtyTiles[tile] = false;
+
+                forEachTileRow(tile, [&](size_t offset, size_t count)
+                {
+                    std::copy(memoryView.begin() + offset, memoryView.begin() + offset + count, output.begin() + offset);
+                });
+            }
+
+            noxitu::metrics::metrics().readBackBytes.add(tiles.size()*TILE_SIZE*TILE_SIZE*4*sizeof(float));
+        }
+    };
+
+    std::unique_ptr<IncrementalSession> ComputeContext::createIncrementalSession()
+    {
+        JobSlot *slot = m_impl->acquireSlot();
+
+        std::unique_ptr<IncrementalSession::Impl> impl;
+
+        try
+        {
+            impl = std::make_unique<IncrementalSession::Impl>(*m_impl, slot);
+        }
+        catch (...)
+        {
+            m_impl->releaseSlot(slot);
+            throw;
+        }
+
+        return std::unique_ptr<IncrementalSession>(new IncrementalSession(std::move(impl)));
+    }
+
+    IncrementalSession::IncrementalSession(std::unique_ptr<Impl> impl) :
+        m_impl(std::move(impl))
+    {
+    }
+
+    IncrementalSession::~IncrementalSession() = default;
+
+    void IncrementalSession::write(int x, int y, int width, int height, const float *values)
+    {
+        if (x < 0 || y < 0 || width < 0 || height < 0 || x + width > GRID_WIDTH || y + height > GRID_HEIGHT)
+            throw std::out_of_range("Write outside of the grid");
+
+        if (width == 0 || height == 0)
+            return;
+
+        m_impl->collect();
+
+        for (int row = 0; row < height; ++row)
+        {
+            const float *source = values + 4*row*width;
+            std::copy(source, source + 4*width, m_impl->input.begin() + 4*((y + row)*GRID_WIDTH + x));
+        }
+
+        for (int tileY = y/TILE_SIZE; tileY <= (y + height - 1)/TILE_SIZE; ++tileY)
+            for (int tileX = x/TILE_SIZE; tileX <= (x + width - 1)/TILE_SIZE; ++tileX)
+                m_impl->dirtyTiles[tileY*GRID_TILES_X + tileX] = true;
+    }
+
+    size_t IncrementalSession::dirtyTileCount() const
+    {
+        m_impl->collect();
+
+        return std::count(m_impl->dirtyTiles.begin(), m_impl->dirtyTiles.end(), true);
+    }
+
+    std::shared_future<void> IncrementalSession::run()
+    {
+        m_impl->collect();
+
+        // Clean tiles are never read back from the slot, so a failed slot can be replaced by any other one.
+        // Failed slot is retired first, so that its place in the pool can be taken by the replacement.
+        if (m_impl->slot && m_impl->slot->failed)
+        {
+            m_impl->context.releaseSlot(m_impl->slot);
+            m_impl->slot = nullptr;
+        }
+
+        if (!m_impl->slot)
+            m_impl->slot = m_impl->context.acquireSlot();
+
+        std::vector<int> tiles;
+
+        for (int tile = 0; tile < GRID_TILES; ++tile)
+        {
+            if (m_impl->dirtyTiles[tile])
+                tiles.push_back(tile);
+        }
+
+        auto promise = std::make_shared<std::promise<void>>();
+        m_impl->pending = promise->get_future().share();
+
+        if (tiles.empty())
+        {
+            promise->set_value();
+            return m_impl->pending;
+        }
+
+        // Slot is owned by this session and no run is pending, so it can be filled without locking.
+        noxitu::span<float> &memoryView = *m_impl->slot->memoryView;
+
+        for (int tile : tiles)
+        {
+            forEachTileRow(tile, [&](size_t offset, size_t count)
+            {
+                std::copy(m_impl->input.begin() + offset, m_impl->input.begin() + offset + count, memoryView.begin() + offset);
+            });
+        }
+
+        noxitu::metrics::metrics().uploadedBytes.add(tiles.size()*TILE_SIZE*TILE_SIZE*4*sizeof(float));
+
+        writeTileTable(*m_impl->slot, tiles);
+
+        // Results stay in the slot (owned by this session) until collect(), so that `output` is never
+        // written concurrently with the caller reading it.
+        auto complete = [promise](const noxitu::span<const float>&)
+        {
+            promise->set_value();
+        };
+
+        auto fail = [promise](std::exception_ptr ex)
+        {
+            promise->set_exception(ex);
+        };
+
+        try
+        {
+            m_impl->context.submitSlot(m_impl->slot, false, std::move(complete), std::move(fail));
+        }
+        catch (...)
+        {
+            promise->set_exception(std::current_exception());
+            throw;
+        }
+
+        m_impl->pendingTiles = std::move(tiles);
+
+        return m_impl->pending;
+    }
+
+    const std::vector<float>& IncrementalSession::pixels()
+    {
+        m_impl->collect();
+
+        if (m_impl->pending.valid())
+            m_impl->pending.get();
+
+        return m_impl->output;
+    }
+}
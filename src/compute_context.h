@@ -0,0 +1,114 @@
+#pragma once
+#include "metrics.h"
+#include "utils.h"
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace noxitu::compute
+{
+    constexpr static const int GRID_WIDTH = 128;
+    constexpr static const int GRID_HEIGHT = 128;
+    constexpr static const int GRID_FLOATS = 4*GRID_WIDTH*GRID_HEIGHT;
+
+    // Grid is processed in TILE_SIZE x TILE_SIZE tiles, one workgroup each (see shader.comp.glsl).
+    constexpr static const int TILE_SIZE = 32;
+    constexpr static const int GRID_TILES_X = GRID_WIDTH/TILE_SIZE;
+    constexpr static const int GRID_TILES_Y = GRID_HEIGHT/TILE_SIZE;
+    constexpr static const int GRID_TILES = GRID_TILES_X*GRID_TILES_Y;
+
+    static_assert(GRID_WIDTH % TILE_SIZE == 0 && GRID_HEIGHT % TILE_SIZE == 0, "Grid must consist of whole tiles");
+
+    struct ComputeJob
+    {
+        // GRID_FLOATS values (vec4 per pixel). Empty means zero-initialized input.
+        std::vector<float> pixels;
+    };
+
+    struct ComputeContextOptions
+    {
+        bool enableValidationLayer = true;
+
+        // Upper limit of pooled job slots (device buffers, descriptors and command buffers). When all slots
+        // are in use, submit() waits for one to be released. Incremental sessions keep their slot while alive.
+        int maxJobSlots = 8;
+
+        // Metrics are periodically written to this file, every `metricsInterval` (must be positive).
+        // Empty path keeps metrics disabled.
+        std::string metricsPath;
+        noxitu::metrics::Format metricsFormat = noxitu::metrics::Format::Prometheus;
+        std::chrono::milliseconds metricsInterval = std::chrono::seconds(10);
+    };
+
+    class IncrementalSession;
+
+    // Owns instance, device, queue and pipeline - created once and shared by all submitted jobs.
+    // Per-job buffers, descriptors and command buffers are pooled and reused between jobs.
+    class ComputeContext
+    {
+    private:
+        class Impl;
+        std::unique_ptr<Impl> m_impl;
+
+        friend class IncrementalSession;
+
+    public:
+        explicit ComputeContext(const ComputeContextOptions &options = {});
+        ~ComputeContext();
+
+        ComputeContext(const ComputeContext&) = delete;
+        ComputeContext& operator=(const ComputeContext&) = delete;
+
+        // Thread safe. Future is resolved with GRID_FLOATS output values once job's fence is signaled.
+        std::future<std::vector<float>> submit(ComputeJob job);
+
+        // Same as above, but output is copied directly into `output` (GRID_FLOATS values, e.g. shared memory).
+        // `output` must stay valid until returned future is ready.
+        std::future<void> submit(ComputeJob job, noxitu::span<float> output);
+
+        // Session keeping its grid on the device between runs, so that only changed tiles are recomputed.
+        // Session holds one of the job slots until destroyed.
+        std::unique_ptr<IncrementalSession> createIncrementalSession();
+    };
+
+    // Grid state kept between runs. Writes mark covered tiles dirty and run() uploads, dispatches and
+    // reads back only dirty tiles - cost scales with size of the change instead of grid size.
+    // Not thread safe, but different sessions (and plain jobs) can be used concurrently.
+    // Session must be destroyed before the ComputeContext that created it.
+    class IncrementalSession
+    {
+    private:
+        class Impl;
+        std::unique_ptr<Impl> m_impl;
+
+        explicit IncrementalSession(std::unique_ptr<Impl> impl);
+
+        friend class ComputeContext;
+
+    public:
+        ~IncrementalSession();
+
+        IncrementalSession(const IncrementalSession&) = delete;
+        IncrementalSession& operator=(const IncrementalSession&) = delete;
+
+        // Copies 4*width*height values (row-major, vec4 per pixel) into input grid at (x, y) and marks covered tiles dirty.
+        // Waits for pending run, but does not throw if it failed - failure is reported by run()'s future and pixels().
+        void write(int x, int y, int width, int height, const float *values);
+
+        // Tiles written since their last successful run. Waits for pending run.
+        size_t dirtyTileCount() const;
+
+        // Recomputes dirty tiles (initially all of them). Waits for previous run, if still pending.
+        // Tiles of a failed run stay dirty and are recomputed by the next run().
+        std::shared_future<void> run();
+
+        // Whole grid (GRID_FLOATS values) as computed by the last run - writes made since then are not
+        // visible until next run(). Waits for pending run and rethrows its error, if it failed.
+        // Reference stays valid while the session exists. Results of a run are copied into it by the first call
+        // on this session made after run() - never by a background thread - so it may be read while a run is pending.
+        const std::vector<float>& pixels();
+    };
+}
@@ -0,0 +1,406 @@
+#include "compute_context.h"
+#include "daemon_protocol.h"
+#include "utils.h"
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    // Write end of the self-pipe - signal handler only writes a byte to it, which wakes up poll() in main loop.
+    int g_stopPipe = -1;
+
+    // Returns read end of the self-pipe, which becomes readable once SIGINT or SIGTERM is received.
+    noxitu::daemon::FileDescriptor installStopHandler()
+    {
+        int pipeFds[2];
+
+        if (::pipe2(pipeFds, O_CLOEXEC | O_NONBLOCK) != 0)
+            throw std::system_error(errno, std::generic_category(), "pipe2 failed");
+
+        g_stopPipe = pipeFds[1];
+
+        struct sigaction action = {};
+        action.sa_handler = [](int)
+        {
+            const int savedErrno = errno;
+            const char byte = 0;
+            [[maybe_unused]] const ssize_t ret = ::write(g_stopPipe, &byte, 1);
+            errno = savedErrno;
+        };
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+
+        sigaction(SIGINT, &action, nullptr);
+        sigaction(SIGTERM, &action, nullptr);
+
+        return noxitu::daemon::FileDescriptor(pipeFds[0]);
+    }
+
+    // Holds exclusive lock on `<socket path>.lock` for the lifetime of the daemon, so that a second daemon started
+    // on the same path refuses to start instead of taking the socket over. Lock file itself is never removed -
+    // removing it would let two daemons lock different files of the same name.
+    noxitu::daemon::FileDescriptor lockSocketPath(const std::string &socketPath)
+    {
+        const std::string lockPath = socketPath + ".lock";
+
+        noxitu::daemon::FileDescriptor lockFile(::open(lockPath.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR));
+
+        if (!lockFile)
+            throw std::system_error(errno, std::generic_category(), "open " + lockPath + " failed");
+
+        if (::flock(lockFile.get(), LOCK_EX | LOCK_NB) != 0)
+        {
+            if (errno == EWOULDBLOCK)
+                throw std::runtime_error("Another daemon is already listening on " + socketPath);
+
+            throw std::system_error(errno, std::generic_category(), "flock " + lockPath + " failed");
+        }
+
+        return lockFile;
+    }
+
+    // Removes socket file on destruction, but only if path still refers to the socket bound by this process.
+    class SocketFile
+    {
+    private:
+        std::string m_path;
+        dev_t m_device;
+        ino_t m_inode;
+
+    public:
+        explicit SocketFile(std::string path) :
+            m_path(std::move(path))
+        {
+            struct stat status;
+
+            if (::stat(m_path.c_str(), &status) != 0)
+                throw std::system_error(errno, std::generic_category(), "stat " + m_path + " failed");
+
+            m_device = status.st_dev;
+            m_inode = status.st_ino;
+        }
+
+        ~SocketFile()
+        {
+            struct stat status;
+
+            if (::stat(m_path.c_str(), &status) == 0 && status.st_dev == m_device && status.st_ino == m_inode)
+                ::unlink(m_path.c_str());
+        }
+
+        SocketFile(const SocketFile&) = delete;
+        SocketFile& operator=(const SocketFile&) = delete;
+    };
+
+    bool isTransientAcceptError(int error)
+    {
+        return error == EMFILE || error == ENFILE || error == ENOBUFS || error == ENOMEM || error == EPROTO || error == EPERM;
+    }
+
+    // Tracks connection threads. Destruction (also during stack unwinding) shuts down all client sockets
+    // and waits for their threads, so that threads never outlive objects they reference.
+    class Connections
+    {
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_changed;
+        std::set<int> m_sockets;
+
+    public:
+        ~Connections()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            for (int socket : m_sockets)
+                ::shutdown(socket, SHUT_RDWR);
+
+            m_changed.wait(lock, [&]() { return m_sockets.empty(); });
+        }
+
+        template<typename Handler>
+        void start(int socket, Handler handler)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_sockets.insert(socket);
+            }
+
+            try
+            {
+                std::thread([this, socket, handler]()
+                {
+                    try
+                    {
+                        handler(socket);
+                    }
+                    catch (const std::exception &ex)
+                    {
+                        std::cerr << noxitu::log(__FILE__, __LINE__) << "Connection failed: " << ex.what() << std::endl;
+                    }
+
+                    finish(socket);
+                }).detach();
+            }
+            catch (...)
+            {
+                finish(socket);
+                throw;
+            }
+        }
+
+    private:
+        void finish(int socket)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_sockets.erase(socket);
+            ::close(socket);
+            m_changed.notify_all();
+        }
+    };
+
+    void sendError(int socket, const std::string &message)
+    {
+        noxitu::daemon::ResponseHeader response{};
+        response.status = noxitu::daemon::Status::Error;
+        response.messageLength = message.size();
+
+        noxitu::daemon::sendAll(socket, &response, sizeof(response));
+        noxitu::daemon::sendAll(socket, message.data(), message.size());
+    }
+
+    // Result memory of a single connection - memfd shared with the client, created and mapped once and then
+    // reused by all requests on the connection, so that jobs do not pay for memfd_create, mmap and page faults.
+    class ResultMemory
+    {
+    private:
+        constexpr static const size_t BYTE_SIZE = noxitu::compute::GRID_FLOATS*sizeof(float);
+
+        noxitu::daemon::FileDescriptor m_memfd;
+        void *m_memory;
+
+    public:
+        ResultMemory() :
+            m_memfd(::memfd_create("noxitu_compute_result", MFD_CLOEXEC))
+        {
+            if (!m_memfd)
+                throw std::system_error(errno, std::generic_category(), "memfd_create failed");
+
+            if (::ftruncate(m_memfd.get(), BYTE_SIZE) != 0)
+                throw std::system_error(errno, std::generic_category(), "ftruncate failed");
+
+            m_memory = ::mmap(nullptr, BYTE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, m_memfd.get(), 0);
+
+            if (m_memory == MAP_FAILED)
+                throw std::system_error(errno, std::generic_category(), "mmap failed");
+        }
+
+        ~ResultMemory()
+        {
+            ::munmap(m_memory, BYTE_SIZE);
+        }
+
+        ResultMemory(const ResultMemory&) = delete;
+        ResultMemory& operator=(const ResultMemory&) = delete;
+
+        int fd() const { return m_memfd.get(); }
+        size_t byteSize() const { return BYTE_SIZE; }
+        noxitu::span<float> view() { return noxitu::span<float>(reinterpret_cast<float*>(m_memory), noxitu::compute::GRID_FLOATS); }
+    };
+
+    // Runs job with output written directly into connection's result memory, which is then passed to the client.
+    void sendResult(int socket, noxitu::compute::ComputeContext &context, noxitu::compute::ComputeJob job, ResultMemory &resultMemory)
+    {
+        context.submit(std::move(job), resultMemory.view()).get();
+
+        noxitu::daemon::ResponseHeader response{};
+        response.status = noxitu::daemon::Status::Ok;
+        response.width = noxitu::compute::GRID_WIDTH;
+        response.height = noxitu::compute::GRID_HEIGHT;
+        response.byteSize = resultMemory.byteSize();
+
+        noxitu::daemon::sendWithFd(socket, &response, sizeof(response), resultMemory.fd());
+    }
+
+    // Data is copied three times per request: input from socket into job (recv), job into the slot's mapped
+    // device memory (submit), and output from the slot into result memory (completion). Result memory itself
+    // is shared with the client, so output is not copied again.
+    void handleConnection(int socket, noxitu::compute::ComputeContext &context)
+    {
+        using namespace noxitu::daemon;
+
+        // Created by first request, so that failure is reported to the client like any other job failure.
+        std::unique_ptr<ResultMemory> resultMemory;
+
+        while (true)
+        {
+            RequestHeader request;
+
+            if (!recvAll(socket, &request, sizeof(request)))
+                return;
+
+            if (request.magic != PROTOCOL_MAGIC || request.version != PROTOCOL_VERSION)
+            {
+                sendError(socket, "Unsupported protocol");
+                return;
+            }
+
+            // Dimensions are part of the protocol, but the pipeline is currently built for a single grid size.
+            if (request.width != noxitu::compute::GRID_WIDTH || request.height != noxitu::compute::GRID_HEIGHT)
+            {
+                sendError(socket, "Unsupported dimensions " + std::to_string(request.width) + "x" + std::to_string(request.height) +
+                                  ", daemon supports " + std::to_string(noxitu::compute::GRID_WIDTH) + "x" + std::to_string(noxitu::compute::GRID_HEIGHT));
+                return;
+            }
+
+            noxitu::compute::ComputeJob job;
+
+            if (request.flags & REQUEST_HAS_INPUT)
+            {
+                job.pixels.resize(noxitu::compute::GRID_FLOATS);
+
+                if (!recvAll(socket, job.pixels.data(), job.pixels.size()*sizeof(float)))
+                    return;
+            }
+
+            try
+            {
+                if (!resultMemory)
+                    resultMemory = std::make_unique<ResultMemory>();
+
+                sendResult(socket, context, std::move(job), *resultMemory);
+            }
+            catch (const std::exception &ex)
+            {
+                std::cerr << noxitu::log(__FILE__, __LINE__) << "Job failed: " << ex.what() << std::endl;
+                sendError(socket, ex.what());
+            }
+        }
+    }
+}
+
+int main(const int argc, const char* const argv[]) try
+{
+    const std::vector<std::string> args(argv+1, argv+argc);
+
+    const std::string socketPath = noxitu::getOption(args, "--socket", noxitu::daemon::DEFAULT_SOCKET_PATH);
+
+    // Checked before creating the context, so that a duplicate daemon fails fast.
+    const noxitu::daemon::FileDescriptor socketLock = lockSocketPath(socketPath);
+
+    noxitu::compute::ComputeContextOptions options;
+    options.enableValidationLayer = (std::find(args.begin(), args.end(), "--nodebug") == args.end());
+    options.metricsPath = noxitu::getOption(args, "--metrics", "");
+    options.metricsFormat = noxitu::metrics::parseFormat(noxitu::getOption(args, "--metrics-format", "prometheus"));
+
+    noxitu::compute::ComputeContext context(options);
+
+    noxitu::daemon::FileDescriptor listenSocket(::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0));
+
+    if (!listenSocket)
+        throw std::system_error(errno, std::generic_category(), "socket failed");
+
+    const sockaddr_un address = noxitu::daemon::socketAddress(socketPath);
+
+    // Lock is held, so an existing socket file is a leftover of a daemon that did not exit cleanly.
+    ::unlink(socketPath.c_str());
+
+    if (::bind(listenSocket.get(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0)
+        throw std::system_error(errno, std::generic_category(), "bind failed");
+
+    const SocketFile socketFile(socketPath);
+
+    // Only owner may connect. Done before listen(), so nobody can connect in the meantime.
+    if (::chmod(socketPath.c_str(), S_IRUSR | S_IWUSR) != 0)
+        throw std::system_error(errno, std::generic_category(), "chmod failed");
+
+    if (::listen(listenSocket.get(), SOMAXCONN) != 0)
+        throw std::system_error(errno, std::generic_category(), "listen failed");
+
+    const noxitu::daemon::FileDescriptor stopPipe = installStopHandler();
+
+    std::cerr << noxitu::log(__FILE__, __LINE__) << "Listening on " << socketPath << std::endl;
+
+    {
+        // Destroyed before context, also when loop below throws.
+        Connections connections;
+
+        while (true)
+        {
+            pollfd fds[2] = {
+                {stopPipe.get(), POLLIN, 0},
+                {listenSocket.get(), POLLIN, 0}
+            };
+
+            if (::poll(fds, 2, -1) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+
+                throw std::system_error(errno, std::generic_category(), "poll failed");
+            }
+
+            if (fds[0].revents != 0)
+                break;
+
+            if (fds[1].revents == 0)
+                continue;
+
+            const int clientSocket = ::accept4(listenSocket.get(), nullptr, nullptr, SOCK_CLOEXEC);
+
+            if (clientSocket < 0)
+            {
+                if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN || errno == EWOULDBLOCK)
+                    continue;
+
+                if (isTransientAcceptError(errno))
+                {
+                    std::cerr << noxitu::log(__FILE__, __LINE__) << "accept failed, retrying: " << std::strerror(errno) << std::endl;
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                    continue;
+                }
+
+                throw std::system_error(errno, std::generic_category(), "accept failed");
+            }
+
+            connections.start(clientSocket, [&context](int socket) { handleConnection(socket, context); });
+        }
+
+        std::cerr << noxitu::log(__FILE__, __LINE__) << "Stopping..." << std::endl;
+    }
+
+    std::cerr << noxitu::log(__FILE__, __LINE__) << "main() done" << std::endl;
+
+    return EXIT_SUCCESS;
+}
+catch(const std::exception &ex)
+{
+    std::cerr << noxitu::log(__FILE__, __LINE__) << "main() failed with exception " << typeid(ex).name() << ": " << ex.what() << std::endl;
+    return EXIT_FAILURE;
+}
+catch(...)
+{
+    std::cerr << noxitu::log(__FILE__, __LINE__) << "main() failed" << std::endl;
+    return EXIT_FAILURE;
+}
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+
+// Binary protocol between compute_daemon and compute_client. Both ends live on the same host,
+// so structures are sent in native byte order and layout.
+//
+// Client sends RequestHeader, followed by 4*width*height floats if REQUEST_HAS_INPUT flag is set.
+// Daemon answers with ResponseHeader. On success a memfd holding `byteSize` bytes of results is
+// attached as SCM_RIGHTS, otherwise header is followed by `messageLength` bytes of error message.
+// Connection can be reused for any number of requests. Daemon passes the same memfd in every response on
+// a connection and overwrites it with each result, so previous result must not be read after sending next request.
+namespace noxitu::daemon
+{
+    constexpr static const char *DEFAULT_SOCKET_PATH = "/tmp/noxitu_compute.sock";
+
+    constexpr static const uint32_t PROTOCOL_MAGIC = 0x4354584e; // "NXTC"
+    constexpr static const uint32_t PROTOCOL_VERSION = 1;
+
+    constexpr static const uint32_t REQUEST_HAS_INPUT = 1;
+
+    enum class Status : uint32_t
+    {
+        Ok = 0,
+        Error = 1
+    };
+
+    // Headers are sent as raw bytes, so they must not contain padding (which could carry stale memory).
+    struct RequestHeader
+    {
+        uint32_t magic = PROTOCOL_MAGIC;
+        uint32_t version = PROTOCOL_VERSION;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t flags = 0;
+    };
+
+    static_assert(sizeof(RequestHeader) == 20, "RequestHeader must not contain padding");
+
+    struct ResponseHeader
+    {
+        uint32_t magic = PROTOCOL_MAGIC;
+        Status status = Status::Ok;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint64_t byteSize = 0;
+        uint32_t messageLength = 0;
+        uint32_t reserved = 0;
+    };
+
+    static_assert(sizeof(ResponseHeader) == 32, "ResponseHeader must not contain padding");
+
+    // Owns file descriptor and closes it on destruction.
+    class FileDescriptor
+    {
+    private:
+        int m_fd = -1;
+
+    public:
+        FileDescriptor() = default;
+        explicit FileDescriptor(int fd) : m_fd(fd) {}
+        ~FileDescriptor() { reset(); }
+
+        FileDescriptor(FileDescriptor &&other) : m_fd(other.release()) {}
+        FileDescriptor& operator=(FileDescriptor &&other) { reset(other.release()); return *this; }
+
+        int get() const { return m_fd; }
+        explicit operator bool() const { return m_fd != -1; }
+
+        int release()
+        {
+            const int fd = m_fd;
+            m_fd = -1;
+            return fd;
+        }
+
+        void reset(int fd = -1)
+        {
+            if (m_fd != -1)
+                ::close(m_fd);
+            m_fd = fd;
+        }
+    };
+
+    inline sockaddr_un socketAddress(const std::string &path)
+    {
+        sockaddr_un address = {};
+        address.sun_family = AF_UNIX;
+
+        if (path.size() >= sizeof(address.sun_path))
+            throw std::runtime_error("Socket path too long: " + path);
+
+        std::strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+        return address;
+    }
+
+    // Returns false if connection was closed before any byte was received.
+    inline bool recvAll(int socket, void *data, size_t size)
+    {
+        char *ptr = reinterpret_cast<char*>(data);
+        size_t received = 0;
+
+        while (received < size)
+        {
+            const ssize_t ret = ::recv(socket, ptr + received, size - received, 0);
+
+            if (ret < 0 && errno == EINTR)
+                continue;
+
+            if (ret < 0)
+                throw std::system_error(errno, std::generic_category(), "recv failed");
+
+            if (ret == 0)
+            {
+                if (received == 0)
+                    return false;
+
+                throw std::runtime_error("Connection closed in the middle of a message");
+            }
+
+            received += ret;
+        }
+
+        return true;
+    }
+
+    inline void sendAll(int socket, const void *data, size_t size)
+    {
+        const char *ptr = reinterpret_cast<const char*>(data);
+        size_t sent = 0;
+
+        while (sent < size)
+        {
+            const ssize_t ret = ::send(socket, ptr + sent, size - sent, MSG_NOSIGNAL);
+
+            if (ret < 0 && errno == EINTR)
+                continue;
+
+            if (ret < 0)
+                throw std::system_error(errno, std::generic_category(), "send failed");
+
+            sent += ret;
+        }
+    }
+
+    // Sends `data` with `fd` attached as SCM_RIGHTS.
+    inline void sendWithFd(int socket, const void *data, size_t size, int fd)
+    {
+        iovec iov = {const_cast<void*>(data), size};
+
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+
+        msghdr message = {};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        cmsghdr *header = CMSG_FIRSTHDR(&message);
+        header->cmsg_level = SOL_SOCKET;
+        header->cmsg_type = SCM_RIGHTS;
+        header->cmsg_len = CMSG_LEN(sizeof(int));
+        std::memcpy(CMSG_DATA(header), &fd, sizeof(int));
+
+        ssize_t ret;
+        do
+        {
+            ret = ::sendmsg(socket, &message, MSG_NOSIGNAL);
+        } while (ret < 0 && errno == EINTR);
+
+        if (ret < 0)
+            throw std::system_error(errno, std::generic_category(), "sendmsg failed");
+
+        if (static_cast<size_t>(ret) < size)
+            sendAll(socket, reinterpret_cast<const char*>(data) + ret, size - ret);
+    }
+
+    // Receives `size` bytes and returns attached file descriptor (or -1 if there was none).
+    inline int recvWithFd(int socket, void *data, size_t size)
+    {
+        iovec iov = {data, size};
+
+        alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+
+        msghdr message = {};
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+
+        ssize_t ret;
+        do
+        {
+            ret = ::recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+        } while (ret < 0 && errno == EINTR);
+
+        if (ret < 0)
+            throw std::system_error(errno, std::generic_category(), "recvmsg failed");
+
+        if (ret == 0)
+            throw std::runtime_error("Connection closed by daemon");
+
+        int fd = -1;
+
+        for (cmsghdr *header = CMSG_FIRSTHDR(&message); header != nullptr; header = CMSG_NXTHDR(&message, header))
+        {
+            if (header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS)
+                std::memcpy(&fd, CMSG_DATA(header), sizeof(int));
+        }
+
+        if (static_cast<size_t>(ret) < size && !recvAll(socket, reinterpret_cast<char*>(data) + ret, size - ret))
+            throw std::runtime_error("Connection closed in the middle of a message");
+
+        return fd;
+    }
+}
@@ -1,330 +1,13 @@
-#include "shaders/comp.spv.h"
+#include "compute_context.h"
 #include "utils.h"
-#include "validation_layer.h"
-
-#include <vulkan/vulkan.hpp>
 
 #include <algorithm>
+#include <fstream>
 #include <iostream>
-#include <memory>
 #include <stdexcept>
 #include <string>
-#include <tuple>
 #include <vector>
 
-namespace noxitu::vulkan
-{
-    vk::Instance createInstance(const vk::ApplicationInfo &applicationInfo, 
-                                const std::vector<const char *> &enabledLayers,
-                                const std::vector<const char *> &enabledExtensions)
-    {
-        return vk::createInstance(
-            vk::InstanceCreateInfo(
-                {},
-                &applicationInfo,
-                enabledLayers.size(),
-                enabledLayers.data(),
-                enabledExtensions.size(),
-                enabledExtensions.data()
-            ),
-            nullptr
-        );
-    }
-
-    std::tuple<vk::Device, vk::Queue, int> createDevice(const vk::PhysicalDevice &physicalDevice,
-                                                        const std::vector<const char *> &enabledLayers)
-    {
-        const int queueFamilyIndex = noxitu::vulkan::findQueueFamilyIndex(
-            physicalDevice,
-            [](const vk::QueueFamilyProperties &properties)
-            {
-                return properties.queueCount > 0 && (properties.queueFlags & vk::QueueFlagBits::eCompute);
-            }
-        );
-
-        const std::vector<vk::DeviceQueueCreateInfo> queueInfos = {
-            vk::DeviceQueueCreateInfo(
-                {},
-                queueFamilyIndex,
-                1,
-                std::vector<float>{1.0f}.data()
-            )
-        };
-
-        const vk::Device device = physicalDevice.createDevice(
-            vk::DeviceCreateInfo(
-                {},
-                queueInfos.size(),
-                queueInfos.data(),
-                enabledLayers.size(),
-                enabledLayers.data(),
-                0,
-                nullptr,
-                nullptr
-            )
-        );
-
-        const vk::Queue queue = device.getQueue(queueFamilyIndex, 0);
-
-        return {device, queue, queueFamilyIndex};
-    }
-
-    vk::Buffer createBuffer(vk::Device device, int bufferSize)
-    {
-        return device.createBuffer(
-            vk::BufferCreateInfo(
-                {},
-                bufferSize,
-                vk::BufferUsageFlagBits::eStorageBuffer,
-                vk::SharingMode::eExclusive
-            )
-        );
-    }
-
-    vk::DeviceMemory allocateBuffer(vk::Buffer buffer, vk::PhysicalDevice physicalDevice, vk::Device device)
-    {
-        const vk::MemoryRequirements memoryRequirements = device.getBufferMemoryRequirements(buffer);
-
-        const int memoryTypeIndex = findMemoryTypeIndex(
-            physicalDevice,
-            memoryRequirements,
-            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent
-        );
-
-        const vk::DeviceMemory deviceMemory = device.allocateMemory(
-            vk::MemoryAllocateInfo(
-                memoryRequirements.size,
-                memoryTypeIndex
-            )
-        );
-
-        device.bindBufferMemory(buffer, deviceMemory, 0);
-
-        return deviceMemory;
-    }
-
-    class MyComputePipeline
-    {
-    public:
-        std::vector<vk::DescriptorSetLayout> descriptorSetLayouts;
-        vk::PipelineLayout pipelineLayout;
-        vk::ShaderModule shader;
-        vk::Pipeline pipeline;
-
-        MyComputePipeline(const vk::Device device)
-        {
-            const std::vector<vk::DescriptorSetLayoutBinding> descriptorBindigns = {
-                vk::DescriptorSetLayoutBinding(
-                    0,
-                    vk::DescriptorType::eStorageBuffer,
-                    1,
-                    vk::ShaderStageFlagBits::eCompute
-                )
-            };
-
-            descriptorSetLayouts = {
-                device.createDescriptorSetLayout(
-                    vk::DescriptorSetLayoutCreateInfo(
-                        {},
-                        descriptorBindigns.size(),
-                        descriptorBindigns.data()
-                    )
-                )
-            };
-            
-            pipelineLayout = device.createPipelineLayout(
-                vk::PipelineLayoutCreateInfo(
-                    {},
-                    descriptorSetLayouts.size(),
-                    descriptorSetLayouts.data()
-                )
-            );
-
-            shader = device.createShaderModule(
-                vk::ShaderModuleCreateInfo(
-                    {},
-                    src_shaders_comp_spv_len,
-                    reinterpret_cast<uint32_t*>(src_shaders_comp_spv)
-                )
-            );
-
-            pipeline = device.createComputePipeline(
-                {},
-                vk::ComputePipelineCreateInfo(
-                    {},
-                    vk::PipelineShaderStageCreateInfo(
-                        {},
-                        vk::ShaderStageFlagBits::eCompute,
-                        shader,
-                        "main"
-                    ),
-                    pipelineLayout
-                )
-            );
-        }
-
-        void destroy(const vk::Device device) const
-        {
-            device.destroy(pipeline);
-
-            device.destroy(pipelineLayout);
-            device.destroy(shader);
-
-            for (auto &descriptorSetLayout : descriptorSetLayouts)
-                device.destroy(descriptorSetLayout);
-        }
-    };
-
-    std::tuple<vk::DescriptorPool, std::vector<vk::DescriptorSet>> 
-    createDescriptors(vk::Device device,
-                      vk::Buffer buffer,
-                      const std::vector<vk::DescriptorSetLayout> &descriptorSetLayouts,
-                      int bufferSize)
-    {
-
-        const std::vector<vk::DescriptorPoolSize> poolSizes = {
-            vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, 1)
-        };
-
-        const vk::DescriptorPool descriptorPool = device.createDescriptorPool(
-            vk::DescriptorPoolCreateInfo(
-                {},
-                1,
-                poolSizes.size(),
-                poolSizes.data()
-            )
-        );
-
-        const std::vector<vk::DescriptorSet> descriptorSets = device.allocateDescriptorSets(
-            vk::DescriptorSetAllocateInfo(
-                descriptorPool,
-                descriptorSetLayouts.size(),
-                descriptorSetLayouts.data()
-            )
-        );
-
-        const vk::DescriptorBufferInfo bufferInfo(
-              buffer,
-              0,
-              bufferSize
-        );
-
-        const std::vector<vk::WriteDescriptorSet> writeDescriptorSets = {
-            vk::WriteDescriptorSet(
-                descriptorSets.at(0),
-                0,
-                0,
-                1,
-                vk::DescriptorType::eStorageBuffer,
-                nullptr,
-                &bufferInfo,
-                nullptr
-            )
-        };
-
-        device.updateDescriptorSets(
-            writeDescriptorSets,
-            {}
-        );
-
-        return {descriptorPool, descriptorSets};
-    }
-
-    std::tuple<vk::CommandPool, vk::CommandBuffer> createCommandBuffer(vk::Device device,
-                             vk::Pipeline pipeline,
-                             vk::PipelineLayout pipelineLayout,
-                             const std::vector<vk::DescriptorSet> &descriptorSets,
-                             int queueFamilyIndex)
-    {
-        const vk::CommandPool commandPool = device.createCommandPool(
-            vk::CommandPoolCreateInfo(
-                {},
-                queueFamilyIndex
-            )
-        );
-
-        const vk::CommandBuffer commandBuffer = device.allocateCommandBuffers(
-            vk::CommandBufferAllocateInfo(
-                commandPool,
-                vk::CommandBufferLevel::ePrimary,
-                1
-            )
-        ).at(0);
-
-        commandBuffer.begin(
-            vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit)
-        );
-
-        commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
-        commandBuffer.bindDescriptorSets(
-            vk::PipelineBindPoint::eCompute,
-            pipelineLayout,
-            0,
-            descriptorSets,
-            {}
-        );
-
-        commandBuffer.dispatch(128/32, 128/32, 1);
-
-        commandBuffer.end();
-
-        return {commandPool, commandBuffer};
-    }
-
-    std::function<void()> submitCommandBuffer(vk::Device device, const std::vector<vk::CommandBuffer> &commandBuffers, vk::Queue queue)
-    {
-        const vk::Fence fence = device.createFence(vk::FenceCreateInfo());
-
-        queue.submit(
-            {
-                vk::SubmitInfo(
-                    0,
-                    nullptr,
-                    nullptr,
-                    commandBuffers.size(),
-                    commandBuffers.data()
-                )
-            },
-            fence
-        );
-
-        return [device, fence=fence]()
-        {
-            device.waitForFences({fence}, VK_TRUE, INFINITE_TIMEOUT);
-            device.destroyFence(fence);
-        };
-    }
-
-    template<typename Type>
-    std::shared_ptr<noxitu::span<Type>> mapMemory(vk::Device device, vk::DeviceMemory deviceMemory, int bufferSize)
-    {
-        void* memory = device.mapMemory(deviceMemory, 0, bufferSize);
-
-        auto spanPtr = std::make_shared<noxitu::span<Type>>(reinterpret_cast<Type*>(memory), bufferSize/sizeof(Type));
-
-        return std::shared_ptr<noxitu::span<Type>>(
-            spanPtr.get(),
-            [device, deviceMemory, spanPtr](auto)
-            {
-                device.unmapMemory(deviceMemory);
-            });
-    }
-}
-
-void printPhysicalDevices(const std::vector<vk::PhysicalDevice> &physicalDevices)
-{
-    std::cerr << noxitu::log(__FILE__, __LINE__) << "Found Physical Devices:\n";
-
-    for (const vk::PhysicalDevice &device : physicalDevices)
-    {
-        const vk::PhysicalDeviceProperties properties = device.getProperties();
-
-        std::cerr << noxitu::log(__FILE__, __LINE__) << " * " << properties.deviceName << '\n';
-    }
-
-    std::cerr << noxitu::log(__FILE__, __LINE__) << std::endl;
-}
-
 void saveArray(const char *path, const noxitu::span<const float> &array)
 {
     std::ofstream out(path);
@@ -332,91 +15,61 @@ void saveArray(const char *path, const noxitu::span<const float> &array)
         out << value << ' ';
 }
 
-
-int main(const int argc, const char* const argv[]) try
+// Runs an incremental session over a full write followed by a partial one, and compares its grid with
+// a plain job computed from the same final input.
+bool checkIncremental(noxitu::compute::ComputeContext &context)
 {
-    const std::vector<std::string> args(argv+1, argv+argc);
+    using namespace noxitu::compute;
 
-    const bool enableValidationLayer = (std::find(args.begin(), args.end(), "--nodebug") == args.end());
+    std::vector<float> input(GRID_FLOATS);
+    for (size_t i = 0; i < input.size(); ++i)
+        input[i] = static_cast<float>(i % 1000);
 
-    std::vector<const char*> enabledLayers;
-    std::vector<const char*> enabledExtensions;
-    
-    noxitu::vulkan::validation_layer::ValidationLayer noxituValidationLayer;
+    auto session = context.createIncrementalSession();
+    session->write(0, 0, GRID_WIDTH, GRID_HEIGHT, input.data());
+    session->run().get();
 
-    if (enableValidationLayer)
-    {
-        const bool enabled = noxituValidationLayer.enable(enabledLayers, enabledExtensions);
+    // Patch crossing tile borders, so that dirty tiles also contain pixels that were not written.
+    const int x = 20, y = 50, width = 40, height = 20;
+    std::vector<float> patch(4*width*height, -1.0f);
 
-        if (!enabled)
-        {
-            std::cerr << noxitu::log(__FILE__, __LINE__) << "Validation layer is not available!" << std::endl;
-        }
-    }
-        
-    vk::ApplicationInfo applicationInfo(
-        "Noxitu Application Name",
-        0, // App Version
-        "Noxitu Engine Name",
-        0, // Engine Version
-        VK_API_VERSION_1_0
-    );
-
-    const vk::Instance instance = noxitu::vulkan::createInstance(applicationInfo, enabledLayers, enabledExtensions);
-
-    noxituValidationLayer.addCallback(instance, std::cerr);
-
-#ifdef __linux__
-    noxituValidationLayer.addCallback(instance, std::ofstream("/tmp/vulkan_log.txt"), true);
-#endif
-
-    const vk::PhysicalDevice physicalDevice = [&]()
-    {
-        const auto physicalDevices = instance.enumeratePhysicalDevices();
-        printPhysicalDevices(physicalDevices);
-        return noxitu::vulkan::findPhysicalDevice(physicalDevices, [](auto&) {return true;});
-    }();
+    for (int row = 0; row < height; ++row)
+        std::copy(patch.begin() + 4*row*width, patch.begin() + 4*(row + 1)*width, input.begin() + 4*((y + row)*GRID_WIDTH + x));
 
-    std::cerr << noxitu::log(__FILE__, __LINE__) << "Using device: " << physicalDevice.getProperties().deviceName << std::endl;
+    session->write(x, y, width, height, patch.data());
+    std::cerr << noxitu::log(__FILE__, __LINE__) << "Dirty tiles: " << session->dirtyTileCount() << "/" << GRID_TILES << std::endl;
+    session->run().get();
 
-    const auto [device, queue, queueFamilyIndex] = noxitu::vulkan::createDevice(physicalDevice, enabledLayers);
+    const std::vector<float> expected = context.submit({input}).get();
+    return session->pixels() == expected;
+}
 
-    const noxitu::vulkan::MyComputePipeline myPipeline(device);
 
-    const int bufferSize = 4*sizeof(float)*128*128;
+int main(const int argc, const char* const argv[]) try
+{
+    const std::vector<std::string> args(argv+1, argv+argc);
 
-    const vk::Buffer buffer = noxitu::vulkan::createBuffer(device, bufferSize);
-    const vk::DeviceMemory memory = noxitu::vulkan::allocateBuffer(buffer, physicalDevice, device);
+    noxitu::compute::ComputeContextOptions options;
+    options.enableValidationLayer = (std::find(args.begin(), args.end(), "--nodebug") == args.end());
+    options.metricsPath = noxitu::getOption(args, "--metrics", "");
+    options.metricsFormat = noxitu::metrics::parseFormat(noxitu::getOption(args, "--metrics-format", "prometheus"));
 
-    const auto [descriptorPool, descriptorSets] = noxitu::vulkan::createDescriptors(device, buffer, myPipeline.descriptorSetLayouts, bufferSize);
+    noxitu::compute::ComputeContext context(options);
 
-    const auto [commandPool, commandBuffer] = noxitu::vulkan::createCommandBuffer(device, myPipeline.pipeline, myPipeline.pipelineLayout, descriptorSets, queueFamilyIndex);
+    if (std::find(args.begin(), args.end(), "--check-incremental") != args.end())
+    {
+        const bool matches = checkIncremental(context);
+        std::cerr << noxitu::log(__FILE__, __LINE__) << "Incremental check " << (matches ? "passed" : "failed") << std::endl;
+        return matches ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
 
-    const auto wait = noxitu::vulkan::submitCommandBuffer(device, {commandBuffer}, queue);
-    wait();
+    std::vector<float> result = context.submit({}).get();
 
     {
         std::cerr << noxitu::log(__FILE__, __LINE__) << "Saving..." << std::endl;
-        const auto memoryView = noxitu::vulkan::mapMemory<float>(device, memory, bufferSize);
-        saveArray("/tmp/array.txt", *memoryView);
+        saveArray("/tmp/array.txt", noxitu::span<const float>(result.data(), result.size()));
     }
 
-    std::cerr << noxitu::log(__FILE__, __LINE__) << "Destroying..." << std::endl;
-
-    device.freeCommandBuffers(commandPool, {commandBuffer});
-    device.destroyCommandPool(commandPool);
-
-    myPipeline.destroy(device);
-
-    device.destroyDescriptorPool(descriptorPool);
-    device.destroyBuffer(buffer);
-    device.freeMemory(memory);
-    device.destroy();
-
-    
-    noxituValidationLayer.destroy();
-    instance.destroy();
-
     std::cerr << noxitu::log(__FILE__, __LINE__) << "main() done" << std::endl;
 
     return EXIT_SUCCESS;
@@ -0,0 +1,240 @@
+#include "metrics.h"
+
+#include "utils.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace noxitu::metrics
+{
+    namespace
+    {
+        struct CounterInfo
+        {
+            const char *name;
+            const char *help;
+            const Counter &counter;
+        };
+
+        struct HistogramInfo
+        {
+            const char *name;
+            const char *help;
+            const DurationHistogram &histogram;
+        };
+
+        std::vector<CounterInfo> counters(const Metrics &metrics)
+        {
+            return {
+                {"noxitu_vulkan_allocate_memory_calls_total", "Number of vkAllocateMemory calls.", metrics.allocateMemoryCalls},
+                {"noxitu_vulkan_allocated_bytes_total", "Bytes of device memory allocated.", metrics.allocatedBytes},
+                {"noxitu_vulkan_map_memory_calls_total", "Number of vkMapMemory calls.", metrics.mapMemoryCalls},
+                {"noxitu_vulkan_mapped_bytes_total", "Bytes of device memory mapped.", metrics.mappedBytes},
+                {"noxitu_vulkan_descriptor_pools_created_total", "Number of descriptor pools created.", metrics.descriptorPoolsCreated},
+                {"noxitu_vulkan_descriptor_sets_allocated_total", "Number of descriptor sets allocated.", metrics.descriptorSetsAllocated},
+                {"noxitu_vulkan_submits_total", "Number of vkQueueSubmit calls.", metrics.submits},
+                {"noxitu_vulkan_submitted_command_buffers_total", "Number of command buffers submitted.", metrics.submittedCommandBuffers},
+                {"noxitu_compute_jobs_completed_total", "Number of compute jobs completed.", metrics.jobsCompleted},
+                {"noxitu_compute_jobs_failed_total", "Number of compute jobs failed.", metrics.jobsFailed},
+                {"noxitu_compute_uploaded_bytes_total", "Bytes of job input copied to device memory.", metrics.uploadedBytes},
+                {"noxitu_compute_read_back_bytes_total", "Bytes of job output copied from device memory.", metrics.readBackBytes},
+            };
+        }
+
+        std::vector<HistogramInfo> histograms(const Metrics &metrics)
+        {
+            return {
+                {"noxitu_vulkan_fence_wait_seconds", "Time blocked in vkWaitForFences.", metrics.fenceWaitDuration},
+            };
+        }
+
+        std::string formatBound(double bound)
+        {
+            std::ostringstream out;
+            out << bound;
+            return out.str();
+        }
+
+        std::string formatPrometheus(const Metrics &metrics)
+        {
+            std::ostringstream out;
+
+            for (const CounterInfo &info : counters(metrics))
+            {
+                out << "# HELP " << info.name << ' ' << info.help << '\n'
+                    << "# TYPE " << info.name << " counter\n"
+                    << info.name << ' ' << info.counter.value() << '\n';
+            }
+
+            for (const HistogramInfo &info : histograms(metrics))
+            {
+                const DurationHistogram::Snapshot snapshot = info.histogram.snapshot();
+
+                out << "# HELP " << info.name << ' ' << info.help << '\n'
+                    << "# TYPE " << info.name << " histogram\n";
+
+                uint64_t cumulative = 0;
+
+                for (size_t i = 0; i < DurationHistogram::BUCKET_BOUNDS.size(); ++i)
+                {
+                    cumulative += snapshot.counts[i];
+                    out << info.name << "_bucket{le=\"" << formatBound(DurationHistogram::BUCKET_BOUNDS[i]) << "\"} " << cumulative << '\n';
+                }
+
+                out << info.name << "_bucket{le=\"+Inf\"} " << snapshot.count << '\n'
+                    << info.name << "_sum " << snapshot.sum << '\n'
+                    << info.name << "_count " << snapshot.count << '\n';
+            }
+
+            return out.str();
+        }
+
+        std::string formatJson(const Metrics &metrics)
+        {
+            std::ostringstream out;
+            out << "{\n";
+
+            const char *separator = "";
+
+            for (const CounterInfo &info : counters(metrics))
+            {
+                out << separator << "  \"" << info.name << "\": " << info.counter.value();
+                separator = ",\n";
+            }
+
+            for (const HistogramInfo &info : histograms(metrics))
+            {
+                const DurationHistogram::Snapshot snapshot = info.histogram.snapshot();
+
+                out << separator << "  \"" << info.name << "\": {\"buckets\": {";
+
+                uint64_t cumulative = 0;
+
+                for (size_t i = 0; i < DurationHistogram::BUCKET_BOUNDS.size(); ++i)
+                {
+                    cumulative += snapshot.counts[i];
+                    out << '"' << formatBound(DurationHistogram::BUCKET_BOUNDS[i]) << "\": " << cumulative << ", ";
+                }
+
+                out << "\"+Inf\": " << snapshot.count << "}, "
+                    << "\"sum\": " << snapshot.sum << ", "
+                    << "\"count\": " << snapshot.count << '}';
+                separator = ",\n";
+            }
+
+            out << "\n}\n";
+            return out.str();
+        }
+
+        // Metrics stay enabled while at least one exporter exists, regardless of destruction order.
+        std::mutex g_exportersMutex;
+        int g_activeExporters = 0;
+
+        void addExporter()
+        {
+            std::lock_guard<std::mutex> lock(g_exportersMutex);
+
+            if (g_activeExporters++ == 0)
+                enable();
+        }
+
+        void removeExporter()
+        {
+            std::lock_guard<std::mutex> lock(g_exportersMutex);
+
+            if (--g_activeExporters == 0)
+                enable(false);
+        }
+    }
+
+    Format parseFormat(const std::string &name)
+    {
+        if (name == "prometheus")
+            return Format::Prometheus;
+
+        if (name == "json")
+            return Format::Json;
+
+        throw std::invalid_argument("Unknown metrics format: " + name);
+    }
+
+    std::string format(const Metrics &metrics, Format format)
+    {
+        switch (format)
+        {
+            case Format::Prometheus: return formatPrometheus(metrics);
+            case Format::Json: return formatJson(metrics);
+        }
+
+        throw std::invalid_argument("Unknown metrics format");
+    }
+
+    Exporter::Exporter(std::string path, Format format, std::chrono::milliseconds interval) :
+        m_path(std::move(path)),
+        m_format(format),
+        m_interval(interval)
+    {
+        if (m_interval <= std::chrono::milliseconds::zero())
+            throw std::invalid_argument("Metrics interval must be positive");
+
+        addExporter();
+
+        try
+        {
+            m_thread = std::thread([this]()
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+
+                while (!m_stopChanged.wait_for(lock, m_interval, [this]() { return m_stopping; }))
+                    dump();
+            });
+        }
+        catch (...)
+        {
+            removeExporter();
+            throw;
+        }
+    }
+
+    Exporter::~Exporter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_stopChanged.notify_all();
+        m_thread.join();
+
+        dump();
+
+        removeExporter();
+    }
+
+    void Exporter::dump() const
+    {
+        const std::string temporaryPath = m_path + ".tmp";
+
+        std::ofstream out(temporaryPath);
+        out << format(metrics(), m_format);
+        out.close();
+
+        if (!out)
+        {
+            std::cerr << noxitu::log(__FILE__, __LINE__) << "Failed to write metrics to " << temporaryPath << std::endl;
+            return;
+        }
+
+        if (std::rename(temporaryPath.c_str(), m_path.c_str()) != 0)
+        {
+            std::cerr << noxitu::log(__FILE__, __LINE__) << "Failed to rename " << temporaryPath << " to " << m_path
+                      << ": " << std::strerror(errno) << std::endl;
+        }
+    }
+}
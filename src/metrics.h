@@ -0,0 +1,171 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Process wide runtime counters. Every update is a single relaxed atomic load when metrics are disabled,
+// and a relaxed atomic add (plus two clock reads for timers) when enabled.
+namespace noxitu::metrics
+{
+    inline std::atomic<bool> g_enabled{false};
+
+    inline bool isEnabled() { return g_enabled.load(std::memory_order_relaxed); }
+    inline void enable(bool enabled = true) { g_enabled.store(enabled, std::memory_order_relaxed); }
+
+    class Counter
+    {
+    private:
+        std::atomic<uint64_t> m_value{0};
+
+    public:
+        void add(uint64_t value = 1)
+        {
+            if (isEnabled())
+                m_value.fetch_add(value, std::memory_order_relaxed);
+        }
+
+        uint64_t value() const { return m_value.load(std::memory_order_relaxed); }
+    };
+
+    class DurationHistogram
+    {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        // Upper bounds in seconds, +Inf bucket is implicit.
+        constexpr static const std::array<double, 12> BUCKET_BOUNDS = {
+            1e-5, 5e-5, 1e-4, 5e-4, 1e-3, 5e-3, 1e-2, 5e-2, 1e-1, 5e-1, 1.0, 5.0
+        };
+
+        struct Snapshot
+        {
+            std::array<uint64_t, BUCKET_BOUNDS.size()+1> counts; // Not cumulative.
+            uint64_t count;
+            double sum;
+        };
+
+    private:
+        std::array<std::atomic<uint64_t>, BUCKET_BOUNDS.size()+1> m_counts = {};
+        std::atomic<uint64_t> m_sumNanoseconds{0};
+
+    public:
+        void observe(Clock::duration duration)
+        {
+            if (!isEnabled())
+                return;
+
+            const uint64_t nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count();
+            const double seconds = nanoseconds * 1e-9;
+
+            size_t bucket = 0;
+            while (bucket < BUCKET_BOUNDS.size() && seconds > BUCKET_BOUNDS[bucket])
+                ++bucket;
+
+            m_counts[bucket].fetch_add(1, std::memory_order_relaxed);
+            m_sumNanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+        }
+
+        Snapshot snapshot() const
+        {
+            Snapshot snapshot = {};
+
+            for (size_t i = 0; i < m_counts.size(); ++i)
+            {
+                snapshot.counts[i] = m_counts[i].load(std::memory_order_relaxed);
+                snapshot.count += snapshot.counts[i];
+            }
+
+            snapshot.sum = m_sumNanoseconds.load(std::memory_order_relaxed) * 1e-9;
+            return snapshot;
+        }
+    };
+
+    // Records lifetime of the scope in the histogram. Clock is not read at all when metrics are disabled.
+    class ScopedTimer
+    {
+    private:
+        DurationHistogram *m_histogram;
+        DurationHistogram::Clock::time_point m_start;
+
+    public:
+        explicit ScopedTimer(DurationHistogram &histogram) :
+            m_histogram(isEnabled() ? &histogram : nullptr)
+        {
+            if (m_histogram)
+                m_start = DurationHistogram::Clock::now();
+        }
+
+        ~ScopedTimer()
+        {
+            if (m_histogram)
+                m_histogram->observe(DurationHistogram::Clock::now() - m_start);
+        }
+
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+    };
+
+    struct Metrics
+    {
+        Counter allocateMemoryCalls;
+        Counter allocatedBytes;
+        Counter mapMemoryCalls;
+        Counter mappedBytes;
+        Counter descriptorPoolsCreated;
+        Counter descriptorSetsAllocated;
+        Counter submits;
+        Counter submittedCommandBuffers;
+        DurationHistogram fenceWaitDuration;
+
+        Counter jobsCompleted;
+        Counter jobsFailed;
+        Counter uploadedBytes;
+        Counter readBackBytes;
+    };
+
+    inline Metrics g_metrics;
+
+    inline Metrics& metrics() { return g_metrics; }
+
+    enum class Format
+    {
+        Prometheus,
+        Json
+    };
+
+    Format parseFormat(const std::string &name);
+
+    std::string format(const Metrics &metrics, Format format);
+
+    // Periodically writes metrics to `path` (through a temporary file and rename, so that readers never see
+    // a partial file). Last dump is done on destruction. Metrics are enabled while any exporter exists, and
+    // disabled again when the last one is destroyed. Failed writes are logged and retried on next interval.
+    // Throws std::invalid_argument if `interval` is not positive.
+    class Exporter
+    {
+    private:
+        std::string m_path;
+        Format m_format;
+        std::chrono::milliseconds m_interval;
+
+        std::mutex m_mutex;
+        std::condition_variable m_stopChanged;
+        bool m_stopping = false;
+        std::thread m_thread;
+
+    public:
+        Exporter(std::string path, Format format, std::chrono::milliseconds interval);
+        ~Exporter();
+
+        Exporter(const Exporter&) = delete;
+        Exporter& operator=(const Exporter&) = delete;
+
+        void dump() const;
+    };
+}
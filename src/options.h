@@ -0,0 +1,21 @@
+#pragma once
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <vector>
+
+// Command line helpers. Kept apart from utils.h, so that they can be used without Vulkan (see client.cpp).
+namespace noxitu
+{
+    // Returns value following `name` in command line arguments.
+    inline std::string getOption(const std::vector<std::string> &args, const std::string &name, const std::string &defaultValue)
+    {
+        auto it = std::find(args.begin(), args.end(), name);
+
+        if (it == args.end() || std::next(it) == args.end())
+            return defaultValue;
+
+        return *std::next(it);
+    }
+}
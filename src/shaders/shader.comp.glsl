@@ -2,6 +2,7 @@
 #extension GL_ARB_separate_shader_objects : enable
 
 
+// One workgroup per tile - local size must match TILE_SIZE in compute_context.h.
 layout (local_size_x = 32, local_size_y = 32, local_size_z = 1 ) in;
 
 
@@ -10,15 +11,27 @@ layout(std140, binding = 0) buffer Buffer
    vec4 pixels[];
 };
 
+// First three values are also consumed by vkCmdDispatchIndirect (workgroup count = tileCount).
+layout(std430, binding = 1) readonly buffer Tiles
+{
+   uint dispatchX;
+   uint dispatchY;
+   uint dispatchZ;
+   uint tileCount;
+   uvec2 tileOffsets[];
+};
+
 
 void main() 
 {
-    if(gl_GlobalInvocationID.x >= 128 || gl_GlobalInvocationID.y >= 128)
+    const uvec2 position = tileOffsets[gl_WorkGroupID.x] + gl_LocalInvocationID.xy;
+
+    if(position.x >= 128 || position.y >= 128)
         return;
 
-    pixels[128 * gl_GlobalInvocationID.y + gl_GlobalInvocationID.x] = vec4(
-        gl_GlobalInvocationID.x,
-        gl_GlobalInvocationID.y,
+    pixels[128 * position.y + position.x] = vec4(
+        position.x,
+        position.y,
         gl_GlobalInvocationID.z,
-        pixels[128 * gl_GlobalInvocationID.y + gl_GlobalInvocationID.x]);
+        pixels[128 * position.y + position.x]);
 }
\ No newline at end of file
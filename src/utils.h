@@ -1,4 +1,6 @@
 #pragma once
+#include "options.h"
+
 #include <vulkan/vulkan.hpp>
 
 #include <algorithm>
@@ -6,6 +8,8 @@
 #include <climits>
 #include <functional>
 #include <iomanip>
+#include <iterator>
+#include <string>
 #include <vector>
 
 namespace noxitu::logger
@@ -61,6 +65,8 @@ namespace noxitu
         Type &operator[](size_t index) { return m_ptr[index]; }
         const Type &operator[](size_t index) const { return m_ptr[index]; }
 
+        size_t size() const { return m_size; }
+
         Type* begin() { return m_ptr; }
         Type* end() { return m_ptr+m_size; }
 
@@ -75,8 +81,8 @@ namespace noxitu::vulkan
 {
     constexpr static const uint64_t INFINITE_TIMEOUT = std::numeric_limits<uint64_t>::max();
 
-    vk::PhysicalDevice findPhysicalDevice(const std::vector<vk::PhysicalDevice> &physicalDevices,
-                                        std::function<bool(const vk::PhysicalDevice&)> condition)
+    inline vk::PhysicalDevice findPhysicalDevice(const std::vector<vk::PhysicalDevice> &physicalDevices,
+                                                 std::function<bool(const vk::PhysicalDevice&)> condition)
     {
         auto it = std::find_if(physicalDevices.begin(), physicalDevices.end(), condition);
 
@@ -86,8 +92,8 @@ namespace noxitu::vulkan
         return *it;
     }
 
-    int findQueueFamilyIndex(vk::PhysicalDevice physicalDevice,
-                             std::function<bool(const vk::QueueFamilyProperties&)> condition)
+    inline int findQueueFamilyIndex(vk::PhysicalDevice physicalDevice,
+                                    std::function<bool(const vk::QueueFamilyProperties&)> condition)
     {
         const std::vector<vk::QueueFamilyProperties> queueFamiliyProperties = physicalDevice.getQueueFamilyProperties();
 
@@ -99,9 +105,9 @@ namespace noxitu::vulkan
         return std::distance(queueFamiliyProperties.begin(), it);
     }
 
-    int findMemoryTypeIndex(vk::PhysicalDevice physicalDevice,
-                            vk::MemoryRequirements memoryRequirements,
-                            vk::MemoryPropertyFlags requiredMemoryPropertyFlags)
+    inline int findMemoryTypeIndex(vk::PhysicalDevice physicalDevice,
+                                   vk::MemoryRequirements memoryRequirements,
+                                   vk::MemoryPropertyFlags requiredMemoryPropertyFlags)
     {
         const vk::PhysicalDeviceMemoryProperties memoryProperties = physicalDevice.getMemoryProperties();
 
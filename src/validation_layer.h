@@ -87,7 +87,7 @@ namespace noxitu::vulkan::validation_layer
         return createResultValue(result, callback, VULKAN_HPP_NAMESPACE_STRING"::Instance::createDebugReportCallbackEXT");
     }
 
-    void destroyDebugCallback(vk::Instance instance, vk::DebugReportCallbackEXT callback)
+    inline void destroyDebugCallback(vk::Instance instance, vk::DebugReportCallbackEXT callback)
     {
         auto vkDestroyDebugReportCallbackEXT = reinterpret_cast<PFN_vkDestroyDebugReportCallbackEXT>(instance.getProcAddr("vkDestroyDebugReportCallbackEXT"));
         
@@ -0,0 +1,360 @@
+#pragma once
+#include "metrics.h"
+#include "utils.h"
+
+#include <vulkan/vulkan.hpp>
+
+#include <functional>
+#include <memory>
+#include <tuple>
+#include <vector>
+
+namespace noxitu::vulkan
+{
+    inline vk::Instance createInstance(const vk::ApplicationInfo &applicationInfo,
+                                       const std::vector<const char *> &enabledLayers,
+                                       const std::vector<const char *> &enabledExtensions)
+    {
+        return vk::createInstance(
+            vk::InstanceCreateInfo(
+                {},
+                &applicationInfo,
+                enabledLayers.size(),
+                enabledLayers.data(),
+                enabledExtensions.size(),
+                enabledExtensions.data()
+            ),
+            nullptr
+        );
+    }
+
+    inline std::tuple<vk::Device, vk::Queue, int> createDevice(const vk::PhysicalDevice &physicalDevice,
+                                                               const std::vector<const char *> &enabledLayers)
+    {
+        const int queueFamilyIndex = noxitu::vulkan::findQueueFamilyIndex(
+            physicalDevice,
+            [](const vk::QueueFamilyProperties &properties)
+            {
+                return properties.queueCount > 0 && (properties.queueFlags & vk::QueueFlagBits::eCompute);
+            }
+        );
+
+        const std::vector<vk::DeviceQueueCreateInfo> queueInfos = {
+            vk::DeviceQueueCreateInfo(
+                {},
+                queueFamilyIndex,
+                1,
+                std::vector<float>{1.0f}.data()
+            )
+        };
+
+        const vk::Device device = physicalDevice.createDevice(
+            vk::DeviceCreateInfo(
+                {},
+                queueInfos.size(),
+                queueInfos.data(),
+                enabledLayers.size(),
+                enabledLayers.data(),
+                0,
+                nullptr,
+                nullptr
+            )
+        );
+
+        const vk::Queue queue = device.getQueue(queueFamilyIndex, 0);
+
+        return {device, queue, queueFamilyIndex};
+    }
+
+    inline vk::Buffer createBuffer(vk::Device device, int bufferSize,
+                                   vk::BufferUsageFlags usage = vk::BufferUsageFlagBits::eStorageBuffer)
+    {
+        return device.createBuffer(
+            vk::BufferCreateInfo(
+                {},
+                bufferSize,
+                usage,
+                vk::SharingMode::eExclusive
+            )
+        );
+    }
+
+    inline vk::DeviceMemory allocateBuffer(vk::Buffer buffer, vk::PhysicalDevice physicalDevice, vk::Device device)
+    {
+        const vk::MemoryRequirements memoryRequirements = device.getBufferMemoryRequirements(buffer);
+
+        const int memoryTypeIndex = findMemoryTypeIndex(
+            physicalDevice,
+            memoryRequirements,
+            vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent
+        );
+
+        const vk::DeviceMemory deviceMemory = device.allocateMemory(
+            vk::MemoryAllocateInfo(
+                memoryRequirements.size,
+                memoryTypeIndex
+            )
+        );
+
+        noxitu::metrics::metrics().allocateMemoryCalls.add();
+        noxitu::metrics::metrics().allocatedBytes.add(memoryRequirements.size);
+
+        device.bindBufferMemory(buffer, deviceMemory, 0);
+
+        return deviceMemory;
+    }
+
+    class MyComputePipeline
+    {
+    public:
+        std::vector<vk::DescriptorSetLayout> descriptorSetLayouts;
+        vk::PipelineLayout pipelineLayout;
+        vk::ShaderModule shader;
+        vk::Pipeline pipeline;
+
+        // Shader code is passed in, so that the generated .spv.h header is included by a single translation unit.
+        MyComputePipeline(const vk::Device device, const unsigned char *shaderCode, size_t shaderCodeSize)
+        {
+            // Binding 0: pixels, binding 1: tile table (see shader.comp.glsl).
+            const std::vector<vk::DescriptorSetLayoutBinding> descriptorBindigns = {
+                vk::DescriptorSetLayoutBinding(
+                    0,
+                    vk::DescriptorType::eStorageBuffer,
+                    1,
+                    vk::ShaderStageFlagBits::eCompute
+                ),
+                vk::DescriptorSetLayoutBinding(
+                    1,
+                    vk::DescriptorType::eStorageBuffer,
+                    1,
+                    vk::ShaderStageFlagBits::eCompute
+                )
+            };
+
+            descriptorSetLayouts = {
+                device.createDescriptorSetLayout(
+                    vk::DescriptorSetLayoutCreateInfo(
+                        {},
+                        descriptorBindigns.size(),
+                        descriptorBindigns.data()
+                    )
+                )
+            };
+
+            pipelineLayout = device.createPipelineLayout(
+                vk::PipelineLayoutCreateInfo(
+                    {},
+                    descriptorSetLayouts.size(),
+                    descriptorSetLayouts.data()
+                )
+            );
+
+            shader = device.createShaderModule(
+                vk::ShaderModuleCreateInfo(
+                    {},
+                    shaderCodeSize,
+                    reinterpret_cast<const uint32_t*>(shaderCode)
+                )
+            );
+
+            pipeline = device.createComputePipeline(
+                {},
+                vk::ComputePipelineCreateInfo(
+                    {},
+                    vk::PipelineShaderStageCreateInfo(
+                        {},
+                        vk::ShaderStageFlagBits::eCompute,
+                        shader,
+                        "main"
+                    ),
+                    pipelineLayout
+                )
+            );
+        }
+
+        void destroy(const vk::Device device) const
+        {
+            device.destroy(pipeline);
+
+            device.destroy(pipelineLayout);
+            device.destroy(shader);
+
+            for (auto &descriptorSetLayout : descriptorSetLayouts)
+                device.destroy(descriptorSetLayout);
+        }
+    };
+
+    // Binds bufferInfos[i] as storage buffer at binding i of the first descriptor set.
+    inline std::tuple<vk::DescriptorPool, std::vector<vk::DescriptorSet>>
+    createDescriptors(vk::Device device,
+                      const std::vector<vk::DescriptorBufferInfo> &bufferInfos,
+                      const std::vector<vk::DescriptorSetLayout> &descriptorSetLayouts)
+    {
+
+        const std::vector<vk::DescriptorPoolSize> poolSizes = {
+            vk::DescriptorPoolSize(vk::DescriptorType::eStorageBuffer, bufferInfos.size())
+        };
+
+        const vk::DescriptorPool descriptorPool = device.createDescriptorPool(
+            vk::DescriptorPoolCreateInfo(
+                {},
+                1,
+                poolSizes.size(),
+                poolSizes.data()
+            )
+        );
+
+        const std::vector<vk::DescriptorSet> descriptorSets = device.allocateDescriptorSets(
+            vk::DescriptorSetAllocateInfo(
+                descriptorPool,
+                descriptorSetLayouts.size(),
+                descriptorSetLayouts.data()
+            )
+        );
+
+        std::vector<vk::WriteDescriptorSet> writeDescriptorSets;
+
+        for (size_t binding = 0; binding < bufferInfos.size(); ++binding)
+        {
+            writeDescriptorSets.push_back(
+                vk::WriteDescriptorSet(
+                    descriptorSets.at(0),
+                    binding,
+                    0,
+                    1,
+                    vk::DescriptorType::eStorageBuffer,
+                    nullptr,
+                    &bufferInfos[binding],
+                    nullptr
+                )
+            );
+        }
+
+        noxitu::metrics::metrics().descriptorPoolsCreated.add();
+        noxitu::metrics::metrics().descriptorSetsAllocated.add(descriptorSets.size());
+
+        device.updateDescriptorSets(
+            writeDescriptorSets,
+            {}
+        );
+
+        return {descriptorPool, descriptorSets};
+    }
+
+    // Command buffer is recorded once and may be submitted many times (but not while still pending).
+    // Workgroup count is read from `indirectBuffer` at submit time, so it can change between submits.
+    inline std::tuple<vk::CommandPool, vk::CommandBuffer> createCommandBuffer(vk::Device device,
+                             vk::Pipeline pipeline,
+                             vk::PipelineLayout pipelineLayout,
+                             const std::vector<vk::DescriptorSet> &descriptorSets,
+                             vk::Buffer indirectBuffer,
+                             int queueFamilyIndex)
+    {
+        const vk::CommandPool commandPool = device.createCommandPool(
+            vk::CommandPoolCreateInfo(
+                {},
+                queueFamilyIndex
+            )
+        );
+
+        const vk::CommandBuffer commandBuffer = device.allocateCommandBuffers(
+            vk::CommandBufferAllocateInfo(
+                commandPool,
+                vk::CommandBufferLevel::ePrimary,
+                1
+            )
+        ).at(0);
+
+        commandBuffer.begin(
+            vk::CommandBufferBeginInfo()
+        );
+
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, pipeline);
+        commandBuffer.bindDescriptorSets(
+            vk::PipelineBindPoint::eCompute,
+            pipelineLayout,
+            0,
+            descriptorSets,
+            {}
+        );
+
+        commandBuffer.dispatchIndirect(indirectBuffer, 0);
+
+        // Makes shader writes visible to host reads of mapped memory after the fence wait - the fence alone does not.
+        commandBuffer.pipelineBarrier(
+            vk::PipelineStageFlagBits::eComputeShader,
+            vk::PipelineStageFlagBits::eHost,
+            {},
+            {vk::MemoryBarrier(vk::AccessFlagBits::eShaderWrite, vk::AccessFlagBits::eHostRead)},
+            {},
+            {}
+        );
+
+        commandBuffer.end();
+
+        return {commandPool, commandBuffer};
+    }
+
+    inline std::function<void()> submitCommandBuffer(vk::Device device, const std::vector<vk::CommandBuffer> &commandBuffers, vk::Queue queue)
+    {
+        const vk::Fence fence = device.createFence(vk::FenceCreateInfo());
+
+        try
+        {
+            queue.submit(
+                {
+                    vk::SubmitInfo(
+                        0,
+                        nullptr,
+                        nullptr,
+                        commandBuffers.size(),
+                        commandBuffers.data()
+                    )
+                },
+                fence
+            );
+        }
+        catch (...)
+        {
+            device.destroyFence(fence);
+            throw;
+        }
+
+        noxitu::metrics::metrics().submits.add();
+        noxitu::metrics::metrics().submittedCommandBuffers.add(commandBuffers.size());
+
+        // Fence is destroyed also when waiting throws (e.g. device lost).
+        return [device, fence=fence]()
+        {
+            try
+            {
+                noxitu::metrics::ScopedTimer timer(noxitu::metrics::metrics().fenceWaitDuration);
+                device.waitForFences({fence}, VK_TRUE, INFINITE_TIMEOUT);
+            }
+            catch (...)
+            {
+                device.destroyFence(fence);
+                throw;
+            }
+            device.destroyFence(fence);
+        };
+    }
+
+    template<typename Type>
+    std::shared_ptr<noxitu::span<Type>> mapMemory(vk::Device device, vk::DeviceMemory deviceMemory, int bufferSize)
+    {
+        void* memory = device.mapMemory(deviceMemory, 0, bufferSize);
+
+        noxitu::metrics::metrics().mapMemoryCalls.add();
+        noxitu::metrics::metrics().mappedBytes.add(bufferSize);
+
+        auto spanPtr = std::make_shared<noxitu::span<Type>>(reinterpret_cast<Type*>(memory), bufferSize/sizeof(Type));
+
+        return std::shared_ptr<noxitu::span<Type>>(
+            spanPtr.get(),
+            [device, deviceMemory, spanPtr](auto)
+            {
+                device.unmapMemory(deviceMemory);
+            });
+    }
+}